@@ -1,8 +1,10 @@
 //201907 kojh create 
 #include <gtest/gtest.h>
 #include <iostream>
+#include <thread>
 #include "elapsed_time.hpp"
 #include "redis_helper.hpp"
+#include "redis_shard_helper.hpp"
 
 //const size_t MAX_LOOP = 100000;
 const size_t MAX_LOOP = 100;
@@ -44,6 +46,8 @@ TEST_F(RedisTest, ConnectServer_fail)
     RedisHelper redis_client1;
     redis_client1.SetIpsPorts("127.0.0.111", 6379);
     EXPECT_FALSE(redis_client1.ConnectServer());
+    EXPECT_EQ(redis_client1.GetLastError().code, REDIS_HELPER_ERR_CONNECT);
+    EXPECT_EQ(redis_client1.GetLastError().endpoint_idx, 0);
     std::cout << redis_client1.GetLastErrMsg() << "\n";
 
     RedisHelper redis_client2;
@@ -146,6 +150,8 @@ TEST_F(RedisTest, PipeInvalidCmd)
     EXPECT_FALSE(redis_helper.EndCmdPipeline());
     ASSERT_TRUE(redis_helper.GetReply() ==NULL);
     ASSERT_TRUE(redis_helper.GetAppendedCmdCnt() ==0);
+    EXPECT_EQ(redis_helper.GetLastError().code, REDIS_HELPER_ERR_REPLY);
+    std::cout << redis_helper.GetLastErrMsg() << "\n";
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -221,3 +227,326 @@ TEST_F(RedisTest, PipeSetPerf)
     ASSERT_TRUE(redis_helper.GetAppendedCmdCnt() ==0);
 }
 
+
+///////////////////////////////////////////////////////////////////////////////
+TEST_F(RedisTest, TransactionRetry)
+{
+    RedisHelper redis_helper;
+    redis_helper.SetIpsPorts("127.0.0.1", 6379);
+    ASSERT_TRUE(redis_helper.ConnectServer());
+    RedisHelper redis_other;
+    redis_other.SetIpsPorts("127.0.0.1", 6379);
+    ASSERT_TRUE(redis_other.ConnectServer());
+    EXPECT_TRUE(redis_helper.DoCommand("SET trans_k1 10"));
+
+    std::vector<std::string> watch_keys;
+    watch_keys.push_back("trans_k1");
+    size_t read_cnt = 0;
+    long long val = 0;
+    bool result = redis_helper.ExecTransaction(watch_keys,
+        [&](RedisHelper& helper) {
+            read_cnt++;
+            if(!helper.DoCommand("GET trans_k1")){
+                return false;
+            }
+            val = atoll(helper.GetReply()->str);
+            if(read_cnt == 1){ 
+                //modify watched key --> first EXEC returns nil
+                redis_other.DoCommand("SET trans_k1 20");
+            }
+            return true;
+        },
+        [&](RedisHelper& helper) {
+            return helper.AppendCmdPipeline("SET trans_k1 %lld", val + 1) &&
+                   helper.AppendCmdPipeline("GET trans_k1");
+        });
+    EXPECT_TRUE(result);
+    EXPECT_EQ(read_cnt, 2u);
+    redisReply* reply = redis_helper.GetReply();
+    ASSERT_TRUE(reply !=NULL);
+    ASSERT_EQ(reply->type, REDIS_REPLY_ARRAY);
+    ASSERT_EQ(reply->elements, 2u);
+    EXPECT_STREQ(reply->element[1]->str, "21");
+
+    //abort in write phase
+    EXPECT_FALSE(redis_helper.ExecTransaction(watch_keys, NULL,
+        [](RedisHelper& helper) {
+            helper.AppendCmdPipeline("SET trans_k1 0");
+            return false;
+        }));
+    EXPECT_EQ(redis_helper.GetLastError().code, REDIS_HELPER_ERR_TRANS_ABORT);
+    EXPECT_TRUE(redis_helper.DoCommand("GET trans_k1"));
+    EXPECT_STREQ(redis_helper.GetReply()->str, "21");
+
+    //caller misuse, not an abort
+    EXPECT_TRUE(redis_helper.AppendCmdPipeline("GET trans_k1"));
+    EXPECT_FALSE(redis_helper.ExecTransaction(watch_keys, NULL, NULL));
+    EXPECT_EQ(redis_helper.GetLastError().code, REDIS_HELPER_ERR_CMD);
+    EXPECT_TRUE(redis_helper.EndCmdPipeline());
+
+    EXPECT_TRUE(redis_helper.DoCommand("DEL trans_k1"));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+TEST_F(RedisTest, ShardKeyMapping)
+{
+    RedisShardHelper shard_helper;
+    for(size_t i=0; i < 4; i++){
+        shard_helper.AddShard();
+    }
+    size_t cnt [4] = {0,};
+    char key [64];
+    for(size_t i=0; i < 10000; i++){
+        snprintf(key, sizeof(key), "shard_k%ld", i);
+        cnt[shard_helper.GetShardIdx(key)]++;
+    }
+    for(size_t i=0; i < 4; i++){
+        EXPECT_GT(cnt[i], 2000u);
+    }
+    //hash tag
+    EXPECT_EQ(shard_helper.GetShardIdx("{user1}.name"), shard_helper.GetShardIdx("{user1}.age"));
+    //adding a shard moves about 1/5 of keys
+    size_t moved = 0;
+    for(size_t i=0; i < 10000; i++){
+        snprintf(key, sizeof(key), "shard_k%ld", i);
+        uint64_t hash = RedisShardHelper::HashKey(key, strlen(key));
+        if(RedisShardHelper::JumpHash(hash, 4) != RedisShardHelper::JumpHash(hash, 5)){
+            moved++;
+        }
+    }
+    EXPECT_LT(moved, 2500u);
+
+    RedisShardHelper no_shard;
+    EXPECT_TRUE(no_shard.GetShard("k1") == NULL);
+    EXPECT_FALSE(no_shard.DoCommand("k1", "GET k1"));
+    EXPECT_FALSE(no_shard.AppendCmdPipeline("k1", "GET k1"));
+    EXPECT_TRUE(no_shard.GetReply() == NULL);
+    EXPECT_STREQ(no_shard.GetLastErrMsg(), "no shard");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+TEST_F(RedisTest, ShardMultiKey)
+{
+    //every shard is the same server here : a database per shard, 
+    //so a key routed to a wrong shard is not found
+    RedisShardHelper shard_helper;
+    const size_t shard_cnt = 3;
+    for(size_t i=0; i < shard_cnt; i++){
+        size_t shard_idx = shard_helper.AddShard();
+        shard_helper.SetIpsPorts(shard_idx, "127.0.0.1", 6379);
+    }
+    ASSERT_TRUE(shard_helper.ConnectServer());
+    for(size_t i=0; i < shard_cnt; i++){
+        ASSERT_TRUE(shard_helper.GetShardAt(i)->DoCommand("SELECT %ld", i+1));
+    }
+
+    std::vector<std::string> keys;
+    std::vector<std::string> key_values;
+    char temp [64];
+    for(size_t i=0; i < MAX_LOOP; i++){
+        snprintf(temp, sizeof(temp), "shard_k%ld", i);
+        keys.push_back(temp);
+        key_values.push_back(temp);
+        snprintf(temp, sizeof(temp), "shard_val_%ld", i);
+        key_values.push_back(temp);
+    }
+    EXPECT_TRUE(shard_helper.MSet(key_values));
+
+    //every key is only in its own shard
+    for(size_t i=0; i < MAX_LOOP; i++){
+        size_t mapped = shard_helper.GetShardIdx(keys[i]);
+        for(size_t shard=0; shard < shard_cnt; shard++){
+            RedisHelper* helper = shard_helper.GetShardAt(shard);
+            ASSERT_TRUE(helper->DoCommand("EXISTS %s", keys[i].c_str()));
+            EXPECT_EQ(helper->GetReply()->integer, shard == mapped ? 1 : 0);
+        }
+    }
+
+    keys.push_back("shard_not_exists");
+    std::vector<std::string> values;
+    std::vector<bool> is_exists;
+    ASSERT_TRUE(shard_helper.MGet(keys, values, &is_exists));
+    ASSERT_EQ(values.size(), keys.size());
+    for(size_t i=0; i < MAX_LOOP; i++){
+        EXPECT_TRUE(is_exists[i]);
+        EXPECT_EQ(values[i], key_values[i*2+1]);
+    }
+    EXPECT_FALSE(is_exists[MAX_LOOP]);
+
+    //routed by the key the command uses
+    std::vector<std::string> cnt_keys;
+    for(size_t i=0; i < MAX_LOOP; i++){
+        snprintf(temp, sizeof(temp), "shard_cnt_%ld", i);
+        cnt_keys.push_back(temp);
+        EXPECT_TRUE(shard_helper.AppendCmdPipeline(cnt_keys[i], "INCR %s", temp));
+    }
+    //multi-key command while pipeline is pending --> fails
+    EXPECT_FALSE(shard_helper.MGet(keys, values));
+    EXPECT_TRUE(shard_helper.GetErrShard() == NULL);
+    EXPECT_TRUE(shard_helper.EndCmdPipeline());
+    for(size_t i=0; i < MAX_LOOP; i++){
+        RedisHelper* helper = shard_helper.GetShard(cnt_keys[i]);
+        ASSERT_TRUE(helper->DoCommand("GET %s", cnt_keys[i].c_str()));
+        EXPECT_STREQ(helper->GetReply()->str, "1");
+    }
+
+    long long deleted_cnt = 0;
+    EXPECT_TRUE(shard_helper.Del(keys, &deleted_cnt));
+    EXPECT_EQ(deleted_cnt, (long long)MAX_LOOP);
+    for(size_t i=0; i < MAX_LOOP; i++){
+        EXPECT_TRUE(shard_helper.DoCommand(cnt_keys[i], "DEL %s", cnt_keys[i].c_str()));
+        EXPECT_EQ(shard_helper.GetReply()->integer, 1);
+    }
+
+    key_values.pop_back(); //odd
+    EXPECT_FALSE(shard_helper.MSet(key_values));
+    EXPECT_TRUE(shard_helper.GetErrShard() == NULL);
+    std::cout << shard_helper.GetLastErrMsg() << "\n";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+TEST_F(RedisTest, ShardPipelineConnLost)
+{
+    RedisShardHelper shard_helper;
+    for(size_t i=0; i < 2; i++){
+        size_t shard_idx = shard_helper.AddShard();
+        shard_helper.SetIpsPorts(shard_idx, "127.0.0.1", 6379);
+    }
+    ASSERT_TRUE(shard_helper.ConnectServer());
+    RedisHelper* shard = shard_helper.GetShardAt(0);
+    ASSERT_TRUE(shard->DoCommand("CLIENT ID"));
+    long long client_id = shard->GetReply()->integer;
+
+    //connection lost with replies pending
+    EXPECT_TRUE(shard->AppendCmdPipeline("PING"));
+    EXPECT_TRUE(shard->AppendCmdPipeline("PING"));
+    RedisHelper redis_other;
+    redis_other.SetIpsPorts("127.0.0.1", 6379);
+    ASSERT_TRUE(redis_other.ConnectServer());
+    EXPECT_TRUE(redis_other.DoCommand("CLIENT KILL ID %lld", client_id));
+    EXPECT_FALSE(shard->EndCmdPipeline()); //reconnected
+    EXPECT_EQ(shard->GetAppendedCmdCnt(), 0u);
+
+    //multi-key commands work after failover
+    std::vector<std::string> keys;
+    keys.push_back("shard_lost_k1");
+    keys.push_back("shard_lost_k2");
+    std::vector<std::string> values;
+    EXPECT_TRUE(shard_helper.MGet(keys, values));
+    EXPECT_EQ(values.size(), keys.size());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+TEST_F(RedisTest, HedgedRead)
+{
+    RedisHelper redis_helper;
+    redis_helper.SetIpsPorts("127.0.0.1", 6379);
+    redis_helper.SetIpsPorts("localhost", 6379); //same server, second read connection
+    ASSERT_TRUE(redis_helper.ConnectServer());
+
+    EXPECT_TRUE(redis_helper.DoCommand("SET hedge_k1 hedge_val_1"));
+    redis_helper.EnableHedgedRead(90.0, 100, 0.1); //hedge after 100 us at least
+    for(size_t i=0; i < MAX_LOOP; i++){
+        ASSERT_TRUE(redis_helper.DoHedgedRead("GET hedge_k1"));
+        ASSERT_TRUE(redis_helper.GetReply() !=NULL);
+        EXPECT_STREQ(redis_helper.GetReply()->str, "hedge_val_1");
+    }
+    //rate limited : ratio * reads + burst
+    EXPECT_LE(redis_helper.GetHedgedCnt(), (size_t)(MAX_LOOP * 0.1) + HEDGE_MAX_TOKENS);
+    std::cout << "hedged =" << redis_helper.GetHedgedCnt() << ", delay(us) =" 
+              << redis_helper.GetHedgeDelayMicroSecs(0) << "," 
+              << redis_helper.GetHedgeDelayMicroSecs(1) << "\n";
+
+    EXPECT_FALSE(redis_helper.DoHedgedRead("HGET hedge_k1 field")); //WRONGTYPE
+    EXPECT_EQ(redis_helper.GetLastError().code, REDIS_HELPER_ERR_REPLY);
+
+    redis_helper.DisableHedgedRead();
+    EXPECT_TRUE(redis_helper.DoHedgedRead("DEL hedge_k1"));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+TEST_F(RedisTest, HedgedReadEveryRead)
+{
+    //no delay, no rate limit : every read with 2 usable endpoints is hedged.
+    //replies of lost requests must never be returned for a later read
+    RedisHelper redis_helper;
+    redis_helper.SetIpsPorts("127.0.0.1", 6379);
+    redis_helper.SetIpsPorts("localhost", 6379);
+    ASSERT_TRUE(redis_helper.ConnectServer());
+
+    const size_t key_cnt = 5;
+    char key [64];
+    char val [64];
+    for(size_t i=0; i < key_cnt; i++){
+        snprintf(key, sizeof(key), "hedge_every_k%ld", i);
+        EXPECT_TRUE(redis_helper.DoCommand("SET %s hedge_every_val_%ld", key, i));
+    }
+    redis_helper.EnableHedgedRead(95.0, 0, 1.0);
+    for(size_t i=0; i < MAX_LOOP; i++){
+        snprintf(key, sizeof(key), "hedge_every_k%ld", i % key_cnt);
+        snprintf(val, sizeof(val), "hedge_every_val_%ld", i % key_cnt);
+        ASSERT_TRUE(redis_helper.DoHedgedRead("GET %s", key));
+        ASSERT_TRUE(redis_helper.GetReply() !=NULL);
+        EXPECT_STREQ(redis_helper.GetReply()->str, val);
+    }
+    EXPECT_GT(redis_helper.GetHedgedCnt(), 0u);
+    std::cout << "hedged =" << redis_helper.GetHedgedCnt() << "\n";
+
+    redis_helper.DisableHedgedRead();
+    for(size_t i=0; i < key_cnt; i++){
+        snprintf(key, sizeof(key), "hedge_every_k%ld", i);
+        EXPECT_TRUE(redis_helper.DoCommand("DEL %s", key));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+TEST_F(RedisTest, HedgedReadFailover)
+{
+    //no hedge (max_ratio 0). the first endpoint is closed after the hedge 
+    //delay : the read fails over to the other endpoint
+    RedisHelper redis_helper;
+    redis_helper.SetIpsPorts("127.0.0.1", 6379);
+    redis_helper.SetIpsPorts("localhost", 6379);
+    ASSERT_TRUE(redis_helper.ConnectServer());
+    redis_helper.EnableHedgedRead(95.0, 1000, 0.0);
+    redis_helper.SetHedgedReadTimeoutMicroSecs(5000000);
+
+    //same delay : first endpoint is used
+    ASSERT_TRUE(redis_helper.DoHedgedRead("CLIENT ID"));
+    long long client_id = redis_helper.GetReply()->integer;
+
+    RedisHelper redis_other;
+    redis_other.SetIpsPorts("127.0.0.1", 6379);
+    ASSERT_TRUE(redis_other.ConnectServer());
+    std::thread killer([&redis_other, client_id]() {
+        usleep(100000); //after hedge delay (1 ms)
+        redis_other.DoCommand("CLIENT KILL ID %lld", client_id);
+    });
+    EXPECT_TRUE(redis_helper.DoHedgedRead("BLPOP hedge_failover_k 1"));
+    killer.join();
+    ASSERT_TRUE(redis_helper.GetReply() !=NULL);
+    EXPECT_EQ(redis_helper.GetReply()->type, REDIS_REPLY_NIL); //BLPOP timeout
+    EXPECT_EQ(redis_helper.GetHedgedCnt(), 0u);
+    redis_helper.DisableHedgedRead();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+TEST_F(RedisTest, LogSink)
+{
+    std::vector<std::string> lines;
+    RedisLogger::Instance().SetSink([&lines](int level, const char* msg) {
+        if(level == REDIS_LOG_LEVEL_ERROR){
+            lines.push_back(msg);
+        }
+    });
+    RedisLogger::Instance().Flush();
+    lines.clear();
+
+    PRINT_ELOG("log sink test " << 1 << "," << std::string("two"));
+    RedisLogger::Instance().Flush();
+    //restore before any assertion can return : the sink refers to 'lines'
+    RedisLogger::Instance().SetSink(RedisLogger::DefaultSink);
+
+    ASSERT_EQ(lines.size(), 1u);
+    EXPECT_TRUE(lines[0].find("log sink test 1,two") != std::string::npos);
+}
@@ -33,39 +33,32 @@
 #include <vector>
 #include <memory>
 #include <functional>
-
-///////////////////////////////////////////////////////////////////////////////
-//color printf
-#define COLOR_RED  "\x1B[31m"
-#define COLOR_GREEN "\x1B[32m" 
-#define COLOR_BLUE "\x1B[34m"
-#define COLOR_RESET "\x1B[0m"
-
-#define  LOG_WHERE "("<<__FILE__<<"-"<<__func__<<"-"<<__LINE__<<") "
-#define  WHERE_DEF __FILE__,__func__,__LINE__
-
-#ifdef DEBUG_PRINTF
-#define  DEBUG_LOG(x)  std::cout<<LOG_WHERE << x << "\n"
-#define  DEBUG_RED_LOG(x) std::cout<<LOG_WHERE << COLOR_RED<< x << COLOR_RESET << "\n"
-#define  DEBUG_GREEN_LOG(x) std::cout<<LOG_WHERE << COLOR_GREEN<< x << COLOR_RESET << "\n"
-#define  DEBUG_ELOG(x) std::cerr<<LOG_WHERE << COLOR_RED<< x << COLOR_RESET << "\n"
-#else
-#define  DEBUG_LOG(x) 
-#define  DEBUG_ELOG(x) 
-#define  DEBUG_RED_LOG(x) 
-#define  DEBUG_GREEN_LOG(x)
-#endif
-#define  PRINT_ELOG(x) std::cerr<<LOG_WHERE << COLOR_RED<< x << COLOR_RESET << "\n"
+#include <errno.h>
+#include <poll.h>
+#include <chrono>
+#include <algorithm>
+#include "redis_helper_log.hpp"
 
 ///////////////////////////////////////////////////////////////////////////////
 const size_t MAX_CMD_LEN = 1024 * 1024 ; //1 mb
 const size_t MAX_CONNECT_RETRY = 50;
+const size_t MAX_TRANS_TRY = 10;
+const size_t TRANS_BACKOFF_MICRO_SECS     = 1000  ; //1 ms, doubled on every retry
+const size_t TRANS_MAX_BACKOFF_MICRO_SECS = 100000; //100 ms
+const size_t HEDGE_SAMPLE_CNT = 64;      //latency samples per endpoint
+const size_t HEDGE_UPDATE_INTERVAL = 16; //recalculate hedge delay every n samples
+const size_t HEDGE_MAX_TOKENS = 10;      //burst of hedged reads
+const size_t HEDGE_CONNECT_TIMEOUT_MICRO_SECS = 200000; //200 ms
+const size_t HEDGE_READ_TIMEOUT_MICRO_SECS    = 1000000; //1 sec
 
 //old_ip, old_port, new_ip, new_port,reconnect_flag
 typedef std::function<void(const char*,size_t,const char*,size_t,bool)> CONNECT_CALLBACK ;
 typedef std::function<void(const char*,size_t,const char*)> DISCONNECT_CALLBACK ;
 typedef std::function<void(const char*)> MSG_CALLBACK ;
 typedef std::function<bool(void)>        ABRT_CALLBACK ;
+class RedisHelper;
+//return false to abort the transaction
+typedef std::function<bool(RedisHelper&)> TRANS_CALLBACK ;
 
 ///////////////////////////////////////////////////////////////////////////////
 class ConnIpPort 
@@ -80,6 +73,73 @@ class ConnIpPort
 };
 typedef std::vector<ConnIpPort> VecConnIpPorts ;
 
+///////////////////////////////////////////////////////////////////////////////
+//read only connection for hedged read (one per SetIpsPorts endpoint)
+class HedgeEndpoint 
+{
+  public:
+    HedgeEndpoint(){
+        ctx               = NULL;
+        pending_discard   = 0;
+        sample_cnt        = 0;
+        sample_pos        = 0;
+        sample_updated    = 0;
+        delay_us          = 0;
+    }
+    redisContext* ctx ;
+    size_t     pending_discard ; //replies of lost requests not read yet
+    long long  samples [HEDGE_SAMPLE_CNT]; //latency micro secs (ring)
+    size_t     sample_cnt ;
+    size_t     sample_pos ;
+    size_t     sample_updated ;
+    long long  delay_us ;        //hedge after this
+};
+typedef std::vector<HedgeEndpoint> VecHedgeEndpoints ;
+
+///////////////////////////////////////////////////////////////////////////////
+typedef enum _ENUM_REDIS_HELPER_ERR_ {
+    REDIS_HELPER_OK = 0,
+    REDIS_HELPER_ERR_CONNECT,       //redisConnectWithTimeout failed
+    REDIS_HELPER_ERR_ALLOC_CTX,     //failed to allocate redis context
+    REDIS_HELPER_ERR_ROLE,          //ROLE command returns null reply
+    REDIS_HELPER_ERR_NOT_MASTER,    //connected but NOT master
+    REDIS_HELPER_ERR_NULL_CTX,      //not connected yet
+    REDIS_HELPER_ERR_CMD,           //no reply (see redis_err)
+    REDIS_HELPER_ERR_REPLY,         //server replied with error (see detail)
+    REDIS_HELPER_ERR_APPEND,        //redisAppendCommand failed
+    REDIS_HELPER_ERR_GET_REPLY,     //redisGetReply failed
+    REDIS_HELPER_ERR_RECONN_ABORT,  //reconnect aborted by user callback
+    REDIS_HELPER_ERR_RECONN_GIVEUP, //reconnect retry count exceeded
+    REDIS_HELPER_ERR_TRANS_ABORT,   //transaction aborted by user callback
+    REDIS_HELPER_ERR_TRANS_RECONN,  //reconnected during transaction (WATCH lost)
+    REDIS_HELPER_ERR_TRANS_CONFLICT,//EXEC returned nil on every try
+    REDIS_HELPER_ERR_TRANS_UNKNOWN, //EXEC sent but no reply : may be committed
+    REDIS_HELPER_ERR_HEDGE_TIMEOUT  //no reply from any endpoint in time
+} ENUM_REDIS_HELPER_ERR;
+
+///////////////////////////////////////////////////////////////////////////////
+//recorded on failure without any allocation. 
+//use RedisHelper::GetLastErrMsg() to get formatted message.
+class RedisError 
+{
+  public:
+    RedisError(){
+        Clear();
+    }
+    void Clear(){
+        code         = REDIS_HELPER_OK;
+        endpoint_idx = -1;
+        redis_err    = 0;
+        sys_errno    = 0;
+        detail[0]    = '\0';
+    }
+    ENUM_REDIS_HELPER_ERR code ;
+    int    endpoint_idx ; //index of SetIpsPorts order, -1 : unknown
+    int    redis_err ;    //redisContext::err
+    int    sys_errno ;
+    char   detail [128];  //redisContext::errstr or error reply
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 class RedisHelper 
@@ -98,9 +158,20 @@ class RedisHelper
         user_abort_cb_      = NULL;
         connected_ip_       =""; 
         connected_port_     =0 ; 
+        connected_idx_      =-1; 
+        connect_cnt_        =0 ; 
         is_connected_       =false;
+        is_err_msg_formatted_ =true;
+        is_hedge_enabled_   =false;
+        hedge_percentile_   =95.0;
+        hedge_min_delay_us_ =1000;
+        hedge_max_ratio_    =0.05;
+        hedge_tokens_       =HEDGE_MAX_TOKENS;
+        hedge_read_timeout_us_ =HEDGE_READ_TIMEOUT_MICRO_SECS;
+        hedged_cnt_         =0;
     }
     virtual ~RedisHelper() {
+        CloseHedgeEndpoints();
         if( ctx_ ) {
             redisFree(ctx_);
             ctx_=NULL;
@@ -118,34 +189,26 @@ class RedisHelper
         is_connected_  = false;
         signal(SIGHUP, SIG_IGN);
         signal(SIGPIPE, SIG_IGN);
-        char port_str [100];
 
         struct timeval timeout = { (long)connect_timeout_, 0 };
-        auto  it_vec  = vec_ip_ports_.begin();
-        for(; it_vec != vec_ip_ports_.end(); ++it_vec){ //------ for
+        for(size_t idx=0; idx < vec_ip_ports_.size(); idx++){ //------ for
+            const ConnIpPort& ip_port = vec_ip_ports_[idx];
             if ( ctx_ ) {
                 redisFree(ctx_);
                 ctx_=NULL;
             }
-            ctx_ = redisConnectWithTimeout(it_vec->ip.c_str(), it_vec->port, timeout);
-            snprintf(port_str, sizeof(port_str),"%ld", it_vec->port);
+            ctx_ = redisConnectWithTimeout(ip_port.ip.c_str(), ip_port.port, timeout);
             if ( ctx_ == 0x00 || ctx_->err ) {
                 if ( ctx_ ) {
-                    err_msg_ =  it_vec->ip+ std::string(":") + 
-                        std::string(port_str) +std::string(",") + ctx_->errstr;
+                    SetLastError(REDIS_HELPER_ERR_CONNECT, (int)idx, ctx_->err, ctx_->errstr);
                     redisFree(ctx_);
                     ctx_=NULL;
-                    DEBUG_ELOG (err_msg_ );
-                    if(user_msg_cb_){
-                        user_msg_cb_(err_msg_.c_str());
-                    }
                 } else {
-                    err_msg_ = it_vec->ip +std::string(",") + 
-                        std::string("failed to allocate redis context");
-                    DEBUG_ELOG (err_msg_ );
-                    if(user_msg_cb_){
-                        user_msg_cb_(err_msg_.c_str());
-                    }
+                    SetLastError(REDIS_HELPER_ERR_ALLOC_CTX, (int)idx, 0, NULL);
+                }
+                DEBUG_ELOG (ip_port.ip<<":"<<ip_port.port<<","<<last_err_.detail);
+                if(user_msg_cb_){
+                    user_msg_cb_(GetLastErrMsg());
                 }
                 continue;
                 //return false;  
@@ -157,6 +220,7 @@ class RedisHelper
             }
             reply_ = (redisReply*)redisCommand(ctx_, "ROLE");
             if(reply_ == NULL){
+                SetLastError(REDIS_HELPER_ERR_ROLE, (int)idx, ctx_->err, ctx_->errstr);
                 DEBUG_RED_LOG("ROLE command returns null reply");
                 return false;
             }
@@ -166,21 +230,23 @@ class RedisHelper
                 }
                 DEBUG_LOG ("reply role -->" << reply_->element[fld]->str );
                 if (!strcmp(reply_->element[fld]->str, "master") ) {
-                    DEBUG_LOG("connect ok :"<<it_vec->ip<<","<<it_vec->port);
+                    DEBUG_LOG("connect ok :"<<ip_port.ip<<","<<ip_port.port);
                     is_connected_  = true;
                     //user_connect_cb_ --> master only
                     if(user_connect_cb_){
                         if(is_reconnect ){ 
                             //true --> reconnect flag
                             user_connect_cb_(connected_ip_.c_str(),connected_port_,
-                                             it_vec->ip.c_str(),it_vec->port,true); 
+                                             ip_port.ip.c_str(),ip_port.port,true); 
                         }else{
                             user_connect_cb_(connected_ip_.c_str(),connected_port_,
-                                             it_vec->ip.c_str(),it_vec->port,false); 
+                                             ip_port.ip.c_str(),ip_port.port,false); 
                         }
                     }
-                    connected_ip_   = it_vec->ip;
-                    connected_port_ = it_vec->port;
+                    connected_ip_   = ip_port.ip;
+                    connected_port_ = ip_port.port;
+                    connected_idx_  = (int)idx;
+                    connect_cnt_++;
                     freeReplyObject(reply_); 
                     reply_=NULL;
                     return true;
@@ -188,11 +254,10 @@ class RedisHelper
             }//for
             freeReplyObject(reply_); 
             reply_=NULL;
-            err_msg_ = it_vec->ip +std::string(",") +std::string(port_str)+
-                std::string(" : ") + std::string("connected but NOT master");
-            DEBUG_LOG (err_msg_ );
+            SetLastError(REDIS_HELPER_ERR_NOT_MASTER, (int)idx, 0, NULL);
+            DEBUG_LOG (ip_port.ip<<","<<ip_port.port<<" : connected but NOT master");
             if(user_msg_cb_){
-                user_msg_cb_(err_msg_.c_str());
+                user_msg_cb_(GetLastErrMsg());
             }
         } //------ for
         return false;
@@ -202,51 +267,60 @@ class RedisHelper
 
     ////////////////////////////////////////////////////////////////////////////
     bool DoCommand(const char* format, ...) {
+        va_list ap;
+        va_start(ap, format);
+        bool result = DoCommandV(format, ap);
+        va_end(ap);
+        return result;
+    }
+    bool DoCommandV(const char* format, va_list ap) {
         if(reply_){
             freeReplyObject(reply_); 
             reply_=NULL;
         }
         while(true){
-            va_list ap;
-            va_start(ap, format);
-            reply_ = (redisReply*)redisvCommand(ctx_, format, ap);
-
+            va_list ap_copy;
+            va_copy(ap_copy, ap);
+            reply_ = (redisReply*)redisvCommand(ctx_, format, ap_copy);
+            va_end(ap_copy);
             if ( !reply_ || reply_->type == REDIS_REPLY_ERROR ) {
-                char temp_str [10];
-                snprintf(temp_str,sizeof(temp_str),"%d", ctx_->err);
-                err_msg_ = std::string("failed,") + ctx_->errstr + std::string(",") + 
-                    std::string(temp_str);
-                DEBUG_ELOG ( format <<":"<<err_msg_ << ", ctx_->err=" << ctx_->err );
-                if(reply_){
-                    freeReplyObject(reply_); 
-                    reply_=NULL;
+                if(OnCommandFailed(format)){
+                    continue; //reconnected, retry
                 }
-                if( IsThisConnectionError(ctx_->err) ){ //reconnect and retry
-                    is_connected_ = false;
-                    if(user_disconnect_cb_){
-                        user_disconnect_cb_(connected_ip_.c_str(), 
-                                            connected_port_, ctx_->errstr );
-                    }
-                    char tmp_msg [128];
-                    snprintf(tmp_msg,sizeof(tmp_msg),"connect error :%s %ld, %s",
-                            connected_ip_.c_str(), connected_port_,ctx_->errstr);
-                    if(user_msg_cb_){
-                        user_msg_cb_(tmp_msg);
-                    }
-                    if(!Reconnect()){
-                        va_end(ap);
-                        return false; 
-                    }else{
-                        va_end(ap);
-                        continue;
-                    }
+                return false;
+            }
+            break;
+        } //while
+        return true;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //binary safe. args[0] is command name
+    bool DoCommandArgv(const std::vector<std::string>& args) {
+        if(reply_){
+            freeReplyObject(reply_); 
+            reply_=NULL;
+        }
+        if(args.empty()){
+            SetLastError(REDIS_HELPER_ERR_CMD, connected_idx_, 0, "empty command");
+            return false;
+        }
+        std::vector<const char*> argv (args.size());
+        std::vector<size_t>      argvlen (args.size());
+        for(size_t i=0; i < args.size(); i++){
+            argv[i]    = args[i].c_str();
+            argvlen[i] = args[i].size();
+        }
+        while(true){
+            reply_ = (redisReply*)redisCommandArgv(ctx_, (int)argv.size(), 
+                                                   &argv[0], &argvlen[0]);
+            if ( !reply_ || reply_->type == REDIS_REPLY_ERROR ) {
+                if(OnCommandFailed(argv[0])){
+                    continue; //reconnected, retry
                 }
-                va_end(ap);
                 return false;
-            }else{ //if error
-                va_end(ap);
-                break;
             }
+            break;
         } //while
         return true;
     }
@@ -255,25 +329,75 @@ class RedisHelper
     //return false cases : Out of memory, Invalid format string, 
     //sdscatlen(C dynamic strings library) fail
     bool AppendCmdPipeline(const char* format, ... )
+    {
+        va_list ap;
+        va_start(ap, format);
+        bool result = AppendCmdPipelineV(format, ap);
+        va_end(ap);
+        return result;
+    } 
+    bool AppendCmdPipelineV(const char* format, va_list ap)
     {
         if(ctx_==NULL){
-            err_msg_ = "ctx_==NULL";
-            DEBUG_ELOG (err_msg_ );
+            SetLastError(REDIS_HELPER_ERR_NULL_CTX, connected_idx_, 0, NULL);
+            DEBUG_ELOG ("ctx_==NULL");
             return false;
         }
-        va_list ap;
-        va_start(ap, format);
         if(REDIS_OK !=redisvAppendCommand(ctx_,format,ap)){
-            va_end(ap);
-            err_msg_ = std::string("error : redisAppendCommand,") + ctx_->errstr;
-            DEBUG_ELOG (err_msg_ );
+            SetLastError(REDIS_HELPER_ERR_APPEND, connected_idx_, ctx_->err, ctx_->errstr);
+            DEBUG_ELOG ("error : redisAppendCommand," << ctx_->errstr);
+            return false;
+        }
+        pipe_appended_cnt_++;
+        return true;
+    } 
+
+    ////////////////////////////////////////////////////////////////////////////
+    //binary safe. args[0] is command name
+    bool AppendCmdPipelineArgv(const std::vector<std::string>& args)
+    {
+        if(ctx_==NULL){
+            SetLastError(REDIS_HELPER_ERR_NULL_CTX, connected_idx_, 0, NULL);
+            DEBUG_ELOG ("ctx_==NULL");
+            return false;
+        }
+        std::vector<const char*> argv (args.size());
+        std::vector<size_t>      argvlen (args.size());
+        for(size_t i=0; i < args.size(); i++){
+            argv[i]    = args[i].c_str();
+            argvlen[i] = args[i].size();
+        }
+        if(args.empty() || 
+           REDIS_OK !=redisAppendCommandArgv(ctx_,(int)argv.size(),&argv[0],&argvlen[0])){
+            SetLastError(REDIS_HELPER_ERR_APPEND, connected_idx_, ctx_->err, ctx_->errstr);
+            DEBUG_ELOG ("error : redisAppendCommandArgv," << ctx_->errstr);
             return false;
         }
-        va_end(ap);
         pipe_appended_cnt_++;
         return true;
     } 
 
+    ////////////////////////////////////////////////////////////////////////////
+    //write appended commands without waiting for replies. 
+    //used to send pipelines to several servers before reading any of them.
+    //on failure, following EndCmdPipeline handles the connection error.
+    bool FlushCmdPipeline()
+    {
+        if(ctx_==NULL){
+            SetLastError(REDIS_HELPER_ERR_NULL_CTX, connected_idx_, 0, NULL);
+            return false;
+        }
+        int done = 0;
+        while(!done){
+            if(REDIS_OK != redisBufferWrite(ctx_, &done)){
+                SetLastError(REDIS_HELPER_ERR_GET_REPLY, connected_idx_, ctx_->err, ctx_->errstr);
+                DEBUG_ELOG ("redisBufferWrite failed :" << ctx_->errstr);
+                return false;
+            }
+        }
+        return true;
+    } 
+
     ////////////////////////////////////////////////////////////////////////////
     bool EndCmdPipeline(bool do_reconnect = true)
     {
@@ -287,20 +411,24 @@ class RedisHelper
             int result = redisGetReply(ctx_,(void**) &reply_); 
             if(REDIS_OK != result){
                 is_connected_ = false;
+                //remaining replies are lost with the connection
+                size_t lost_cnt = pipe_appended_cnt_;
+                pipe_appended_cnt_ = 0;
+                SetLastError(REDIS_HELPER_ERR_GET_REPLY, connected_idx_, ctx_->err, ctx_->errstr);
                 if( IsThisConnectionError(ctx_->err) ){ //reconnect and retry
                     if(user_disconnect_cb_){
                         user_disconnect_cb_(connected_ip_.c_str(), 
                                             connected_port_,ctx_->errstr);
                     }
-                    char tmp_msg [128];
-                    snprintf(tmp_msg,sizeof(tmp_msg),"(%s:%d) redisGetReply failed :%s %ld, "
-                            "pipe_appended_cnt_= %ld, %s",
-                            __func__,__LINE__, connected_ip_.c_str(), connected_port_,
-                            pipe_appended_cnt_, ctx_->errstr);
-                    err_msg_ = std::string(tmp_msg) + std::string(":") + 
-                               std::string(strerror(errno)) ;
-                    DEBUG_ELOG (err_msg_);
+                    DEBUG_ELOG ("redisGetReply failed :" << connected_ip_ << " " << 
+                                connected_port_ << ", pipe_appended_cnt_= " << 
+                                lost_cnt << ", " << ctx_->errstr);
                     if(user_msg_cb_){
+                        char tmp_msg [128];
+                        snprintf(tmp_msg,sizeof(tmp_msg),"(%s:%d) redisGetReply failed :%s %ld, "
+                                "pipe_appended_cnt_= %ld, %s",
+                                __func__,__LINE__, connected_ip_.c_str(), connected_port_,
+                                lost_cnt, ctx_->errstr);
                         user_msg_cb_(tmp_msg);
                     }
                     if(do_reconnect){
@@ -314,11 +442,10 @@ class RedisHelper
             }
             if ( !reply_ || reply_->type == REDIS_REPLY_ERROR ) {
                 DEBUG_LOG ("ctx_->err= " << ctx_->err );
-                char tmp_port [8];    
-                snprintf(tmp_port,sizeof(tmp_port),"%ld", connected_port_);
-                err_msg_ = connected_ip_ + std::string(":") + std::string(tmp_port) +
-                    std::string(" -> failed,") + std::string(reply_->str);
-                DEBUG_ELOG (err_msg_ );
+                SetLastError(REDIS_HELPER_ERR_REPLY, connected_idx_, ctx_->err, 
+                             reply_ ? reply_->str : NULL);
+                DEBUG_ELOG (connected_ip_ << ":" << connected_port_ << " -> failed," << 
+                            last_err_.detail );
                 is_error=true; 
             }
             if(reply_){
@@ -334,6 +461,271 @@ class RedisHelper
         return true;
     } 
 
+    ////////////////////////////////////////////////////////////////////////////
+    //read all appended replies, keep the last one in reply_ (GetReply).
+    //unlike EndCmdPipeline, error replies are not treated as failure.
+    bool EndCmdPipelineLastReply() {
+        if(reply_){
+            freeReplyObject(reply_); 
+            reply_=NULL;
+        }
+        while( pipe_appended_cnt_ > 0 ){
+            redisReply* reply = NULL;
+            if(REDIS_OK != redisGetReply(ctx_,(void**) &reply)){
+                is_connected_ = false;
+                pipe_appended_cnt_ = 0;
+                SetLastError(REDIS_HELPER_ERR_GET_REPLY, connected_idx_, ctx_->err, ctx_->errstr);
+                DEBUG_ELOG ("redisGetReply failed :" << ctx_->errstr);
+                if( IsThisConnectionError(ctx_->err) ){ 
+                    if(user_disconnect_cb_){
+                        user_disconnect_cb_(connected_ip_.c_str(), 
+                                            connected_port_,ctx_->errstr);
+                    }
+                    Reconnect();
+                }
+                return false; 
+            }
+            pipe_appended_cnt_--;
+            if(pipe_appended_cnt_ == 0){
+                reply_ = reply;
+            }else{
+                freeReplyObject(reply); 
+            }
+        } //while
+        return true;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //optimistic transaction (check-and-set).
+    //  WATCH watch_keys -> read_cb -> MULTI, write_cb, EXEC (one write)
+    //read_cb  : read watched keys with DoCommand.
+    //write_cb : queue commands with AppendCmdPipeline only (no DoCommand).
+    //retried with backoff while EXEC returns nil (watched key modified).
+    //aborted (REDIS_HELPER_ERR_TRANS_RECONN) if reconnected before EXEC is 
+    //sent, because WATCH is gone. if EXEC was sent but its reply is lost, 
+    //the transaction may be committed : REDIS_HELPER_ERR_TRANS_UNKNOWN, 
+    //do not blindly retry non-idempotent writes on this code.
+    //aborted by a callback : REDIS_HELPER_ERR_TRANS_ABORT. connection errors
+    //during the callbacks are kept as the last error.
+    //on success, GetReply() is the EXEC result array. 
+    //(a command that failed inside EXEC is an error element of that array)
+    bool ExecTransaction(const std::vector<std::string>& watch_keys, 
+                         TRANS_CALLBACK read_cb, TRANS_CALLBACK write_cb,
+                         size_t max_try = MAX_TRANS_TRY)
+    {
+        if(pipe_appended_cnt_ > 0){
+            SetLastError(REDIS_HELPER_ERR_CMD, connected_idx_, 0, 
+                         "pipeline commands pending");
+            return false;
+        }
+        std::vector<std::string> watch_args;
+        if(!watch_keys.empty()){
+            watch_args.reserve(watch_keys.size()+1);
+            watch_args.push_back("WATCH");
+            watch_args.insert(watch_args.end(), watch_keys.begin(), watch_keys.end());
+        }
+        size_t backoff = TRANS_BACKOFF_MICRO_SECS;
+        for(size_t try_cnt=1; ; try_cnt++){
+            //------------------- read phase
+            if(!watch_args.empty() && !DoCommandArgv(watch_args)){
+                return false;
+            }
+            size_t connect_cnt = connect_cnt_;
+            bool is_read_ok = (read_cb == NULL) || read_cb(*this);
+            if(connect_cnt != connect_cnt_){
+                SetLastError(REDIS_HELPER_ERR_TRANS_RECONN, connected_idx_, 0, "read phase");
+                DEBUG_ELOG ("reconnected during read phase");
+                return false;
+            }
+            if(!is_read_ok){
+                //connection error : keep its error
+                if(is_connected_ && ctx_ != NULL){
+                    DoCommand("UNWATCH");
+                    SetLastError(REDIS_HELPER_ERR_TRANS_ABORT, connected_idx_, 0, "read phase");
+                }
+                return false;
+            }
+            //------------------- write phase
+            bool is_write_ok  = AppendCmdPipeline("MULTI");
+            bool is_cb_abort  = false;
+            if(is_write_ok && write_cb != NULL){
+                is_write_ok = write_cb(*this);
+                is_cb_abort = !is_write_ok;
+            }
+            if(!is_write_ok || !AppendCmdPipeline("EXEC")){
+                if(ctx_ == NULL){
+                    return false; //NULL_CTX is kept
+                }
+                //nothing sent yet. DISCARD also unwatches
+                RedisError cause = last_err_;
+                AppendCmdPipeline("DISCARD");
+                if(!EndCmdPipelineLastReply()){
+                    OnTransReplyFailed(connect_cnt);
+                    return false; 
+                }
+                if(is_cb_abort){
+                    SetLastError(REDIS_HELPER_ERR_TRANS_ABORT, connected_idx_, 0, "write phase");
+                }else{
+                    last_err_ = cause; //append failed
+                    is_err_msg_formatted_ = false;
+                }
+                return false;
+            }
+            if(!EndCmdPipelineLastReply()){
+                SetLastError(REDIS_HELPER_ERR_TRANS_UNKNOWN, connected_idx_, 
+                             last_err_.redis_err, "EXEC sent, reply lost");
+                DEBUG_ELOG ("EXEC reply lost, outcome unknown");
+                return false;
+            }
+            //------------------- EXEC result
+            if(reply_ == NULL){
+                SetLastError(REDIS_HELPER_ERR_CMD, connected_idx_, ctx_->err, ctx_->errstr);
+                return false;
+            }
+            if(reply_->type == REDIS_REPLY_ERROR){ //EXECABORT
+                SetLastError(REDIS_HELPER_ERR_REPLY, connected_idx_, 0, reply_->str);
+                DEBUG_ELOG ("EXEC failed :" << last_err_.detail);
+                freeReplyObject(reply_); 
+                reply_=NULL;
+                return false;
+            }
+            if(reply_->type != REDIS_REPLY_NIL){
+                return true;
+            }
+            freeReplyObject(reply_); 
+            reply_=NULL;
+            if(try_cnt >= max_try){
+                SetLastError(REDIS_HELPER_ERR_TRANS_CONFLICT, connected_idx_, 0, NULL);
+                DEBUG_ELOG ("transaction conflict, give up :" << try_cnt);
+                return false;
+            }
+            DEBUG_LOG ("EXEC nil, retry :" << try_cnt << ", backoff=" << backoff);
+            usleep(backoff); 
+            backoff *= 2;
+            if(backoff > TRANS_MAX_BACKOFF_MICRO_SECS){
+                backoff = TRANS_MAX_BACKOFF_MICRO_SECS;
+            }
+        } //for
+        return false;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //hedged read (opt-in) : read only commands are sent to the fastest endpoint
+    //(master or replica, own connections). if no reply within the endpoint's 
+    //latency percentile, the same command is sent to the next fastest one and
+    //the first non error reply wins. replicas may return stale data.
+    //call after SetIpsPorts. read connections are made here and by 
+    //ReconnectHedgeEndpoints only, never while reading.
+    //percentile   : hedge delay = this percentile of recent latencies
+    //min_delay_us : lower bound of hedge delay (also used until samples exist)
+    //max_ratio    : hedged reads / reads upper bound (token bucket).
+    //               0 : no hedge, failover only
+    //a hedged read fails (REDIS_HELPER_ERR_HEDGE_TIMEOUT) if no reply within
+    //SetHedgedReadTimeoutMicroSecs (default HEDGE_READ_TIMEOUT_MICRO_SECS).
+    void EnableHedgedRead(double percentile = 95.0, size_t min_delay_us = 1000, 
+                          double max_ratio = 0.05) {
+        hedge_percentile_   = percentile;
+        hedge_min_delay_us_ = min_delay_us;
+        hedge_max_ratio_    = max_ratio;
+        hedge_tokens_       = (max_ratio > 0) ? (double)HEDGE_MAX_TOKENS : 0.0;
+        is_hedge_enabled_   = true;
+        ReconnectHedgeEndpoints();
+    }
+    void SetHedgedReadTimeoutMicroSecs(size_t micro_secs) { 
+        hedge_read_timeout_us_ = micro_secs; 
+    }
+    //connect closed read connections (blocking, HEDGE_CONNECT_TIMEOUT_MICRO_SECS
+    //per endpoint). call it periodically, outside of latency sensitive reads.
+    //returns the number of usable endpoints
+    size_t ReconnectHedgeEndpoints() {
+        if(!is_hedge_enabled_){
+            return 0;
+        }
+        if(vec_hedge_eps_.size() != vec_ip_ports_.size()){
+            vec_hedge_eps_.resize(vec_ip_ports_.size());
+        }
+        size_t usable_cnt = 0;
+        for(size_t i=0; i < vec_hedge_eps_.size(); i++){
+            HedgeEndpoint& ep = vec_hedge_eps_[i];
+            if(ep.ctx == NULL){
+                struct timeval timeout = { 0, (long)HEDGE_CONNECT_TIMEOUT_MICRO_SECS };
+                ep.ctx = redisConnectWithTimeout(vec_ip_ports_[i].ip.c_str(), 
+                                                 vec_ip_ports_[i].port, timeout);
+                if(ep.ctx == NULL || ep.ctx->err){
+                    DEBUG_RED_LOG ("hedge connect failed :" << vec_ip_ports_[i].ip << 
+                                   ":" << vec_ip_ports_[i].port);
+                    CloseHedgeEndpoint((int)i);
+                    continue;
+                }
+                if(ep.delay_us == 0){
+                    ep.delay_us = hedge_min_delay_us_;
+                }
+            }
+            usable_cnt++;
+        }
+        return usable_cnt;
+    }
+    void DisableHedgedRead() {
+        is_hedge_enabled_ = false;
+        CloseHedgeEndpoints();
+    }
+    size_t GetHedgedCnt() { return hedged_cnt_; }
+    //-1 : unknown endpoint
+    long long GetHedgeDelayMicroSecs(size_t endpoint_idx) {
+        if(endpoint_idx >= vec_hedge_eps_.size()){
+            return -1;
+        }
+        return vec_hedge_eps_[endpoint_idx].delay_us;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //same as DoCommand if hedged read is not enabled or no endpoint is usable.
+    //on failure, GetLastError().endpoint_idx is the endpoint that failed
+    bool DoHedgedRead(const char* format, ...) {
+        va_list ap;
+        va_start(ap, format);
+        bool result = DoHedgedReadV(format, ap);
+        va_end(ap);
+        return result;
+    }
+    bool DoHedgedReadV(const char* format, va_list ap) {
+        if(!is_hedge_enabled_){
+            return DoCommandV(format, ap);
+        }
+        if(reply_){
+            freeReplyObject(reply_); 
+            reply_=NULL;
+        }
+        char* cmd = NULL;
+        va_list ap_copy;
+        va_copy(ap_copy, ap);
+        int cmd_len = redisvFormatCommand(&cmd, format, ap_copy);
+        va_end(ap_copy);
+        if(cmd_len <= 0){
+            SetLastError(REDIS_HELPER_ERR_APPEND, connected_idx_, 0, "invalid format");
+            return false;
+        }
+        int endpoint_idx = -1;
+        int result = HedgedRead(cmd, (size_t)cmd_len, &endpoint_idx);
+        redisFreeCommand(cmd);
+        if(result == 0){
+            DEBUG_RED_LOG ("no hedge endpoint, use master : " << format);
+            return DoCommandV(format, ap);
+        }
+        if(result < 0){
+            DEBUG_ELOG ( format <<":"<< GetLastErrMsg() );
+            return false;
+        }
+        if(reply_->type == REDIS_REPLY_ERROR){
+            SetLastError(REDIS_HELPER_ERR_REPLY, endpoint_idx, 0, reply_->str);
+            DEBUG_ELOG ( format <<":"<<last_err_.detail );
+            freeReplyObject(reply_); 
+            reply_=NULL;
+            return false;
+        }
+        return true;
+    }
+
     ////////////////////////////////////////////////////////////////////////////
     redisReply* GetReply() { 
         return reply_; 
@@ -356,35 +748,36 @@ class RedisHelper
                 retry++;
             }
             if(!ConnectServer(true )) { //true -> is_reconnect
-                snprintf(tmp_msg,sizeof(tmp_msg),"connect failed, retry:%s %ld",
-                         connected_ip_.c_str(), connected_port_);
-                DEBUG_ELOG (tmp_msg);
+                DEBUG_ELOG ("connect failed, retry:" << connected_ip_ << " " << connected_port_);
                 usleep(reconnect_interval_micro_secs_); 
             }else{
-                snprintf(tmp_msg,sizeof(tmp_msg),"reconnect OK :%s:%ld ",
-                         connected_ip_.c_str(),connected_port_ );
                 if(user_msg_cb_){
+                    snprintf(tmp_msg,sizeof(tmp_msg),"reconnect OK :%s:%ld ",
+                             connected_ip_.c_str(),connected_port_ );
                     user_msg_cb_(tmp_msg);
                 }
-                DEBUG_GREEN_LOG (tmp_msg);
+                DEBUG_GREEN_LOG ("reconnect OK :" << connected_ip_ << ":" << connected_port_);
                 return true;
             }
             if(user_abort_cb_!=NULL && user_abort_cb_()){
-                snprintf(tmp_msg,sizeof(tmp_msg),"abort reconnect :%s %ld",
-                         connected_ip_.c_str(), connected_port_);
+                SetLastError(REDIS_HELPER_ERR_RECONN_ABORT, connected_idx_, 0, NULL);
                 if(user_msg_cb_){
+                    snprintf(tmp_msg,sizeof(tmp_msg),"abort reconnect :%s %ld",
+                             connected_ip_.c_str(), connected_port_);
                     user_msg_cb_(tmp_msg);
                 }
-                DEBUG_ELOG (tmp_msg);
+                DEBUG_ELOG ("abort reconnect :" << connected_ip_ << " " << connected_port_);
                 break;
             }
             if(max_reconn_retry_>0 && retry >= max_reconn_retry_){
-                snprintf(tmp_msg,sizeof(tmp_msg),"reconnect failed, give up :%s %ld",
-                         connected_ip_.c_str(), connected_port_);
+                SetLastError(REDIS_HELPER_ERR_RECONN_GIVEUP, connected_idx_, 0, NULL);
                 if(user_msg_cb_){
+                    snprintf(tmp_msg,sizeof(tmp_msg),"reconnect failed, give up :%s %ld",
+                             connected_ip_.c_str(), connected_port_);
                     user_msg_cb_(tmp_msg);
                 }
-                DEBUG_ELOG (tmp_msg);
+                DEBUG_ELOG ("reconnect failed, give up :" << connected_ip_ << " " << 
+                            connected_port_);
                 break;
             }
         }//while
@@ -412,13 +805,46 @@ class RedisHelper
     void   SetReconnectInterval (size_t micro_secs){ reconnect_interval_micro_secs_ = micro_secs ;}
     size_t GetAppendedCmdCnt  (){ return pipe_appended_cnt_  ; }
     void   ReSetAppendedCmdCnt(){ pipe_appended_cnt_ =0 ; }
-    const char* GetLastErrMsg (){ return err_msg_.c_str(); }
+    const  RedisError& GetLastError() { return last_err_; }
+    //formatted only when called
+    const char* GetLastErrMsg () { 
+        if(!is_err_msg_formatted_){
+            FormatLastError();
+            is_err_msg_formatted_ = true;
+        }
+        return err_msg_.c_str(); 
+    }
     const char* GetSvrIp() { return connected_ip_.c_str(); }
     size_t GetSvrPort()    { return connected_port_ ; } 
     bool   IsConnected()   { return is_connected_ ; } 
     bool IsThisConnectionError() {
         return IsThisConnectionError(ctx_->err);
     }
+
+    ////////////////////////////////////////////////////////////////////////////
+    static const char* GetErrCodeStr(ENUM_REDIS_HELPER_ERR code) {
+        switch(code){
+            case REDIS_HELPER_OK                : return "ok";
+            case REDIS_HELPER_ERR_CONNECT       : return "connect failed";
+            case REDIS_HELPER_ERR_ALLOC_CTX     : return "failed to allocate redis context";
+            case REDIS_HELPER_ERR_ROLE          : return "ROLE command returns null reply";
+            case REDIS_HELPER_ERR_NOT_MASTER    : return "connected but NOT master";
+            case REDIS_HELPER_ERR_NULL_CTX      : return "ctx_==NULL";
+            case REDIS_HELPER_ERR_CMD           : return "command failed";
+            case REDIS_HELPER_ERR_REPLY         : return "error reply";
+            case REDIS_HELPER_ERR_APPEND        : return "redisAppendCommand failed";
+            case REDIS_HELPER_ERR_GET_REPLY     : return "redisGetReply failed";
+            case REDIS_HELPER_ERR_RECONN_ABORT  : return "reconnect aborted";
+            case REDIS_HELPER_ERR_RECONN_GIVEUP : return "reconnect failed, give up";
+            case REDIS_HELPER_ERR_TRANS_ABORT   : return "transaction aborted";
+            case REDIS_HELPER_ERR_TRANS_RECONN  : return "reconnected during transaction";
+            case REDIS_HELPER_ERR_TRANS_CONFLICT: return "transaction conflict, give up";
+            case REDIS_HELPER_ERR_TRANS_UNKNOWN : return "transaction outcome unknown";
+            case REDIS_HELPER_ERR_HEDGE_TIMEOUT : return "hedged read timeout";
+        }
+        return "unknown";
+    }
+
   protected:
 
     ////////////////////////////////////////////////////////////////////////////
@@ -431,6 +857,355 @@ class RedisHelper
         return false;
     }
 
+    ////////////////////////////////////////////////////////////////////////////
+    //failure before EXEC is sent : nothing committed
+    void OnTransReplyFailed(size_t connect_cnt) {
+        if(connect_cnt != connect_cnt_){
+            SetLastError(REDIS_HELPER_ERR_TRANS_RECONN, connected_idx_, 0, "write phase");
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //reply_ is null or error reply. 
+    //return true if reconnected and the command should be retried
+    bool OnCommandFailed(const char* cmd) {
+        (void)cmd; //when logging is compiled out
+        if(reply_){
+            SetLastError(REDIS_HELPER_ERR_REPLY, connected_idx_, ctx_->err, reply_->str);
+            freeReplyObject(reply_); 
+            reply_=NULL;
+        }else{
+            SetLastError(REDIS_HELPER_ERR_CMD, connected_idx_, ctx_->err, ctx_->errstr);
+        }
+        DEBUG_ELOG ( cmd <<":"<<last_err_.detail << ", ctx_->err=" << ctx_->err );
+        if( IsThisConnectionError(ctx_->err) ){ //reconnect and retry
+            is_connected_ = false;
+            if(user_disconnect_cb_){
+                user_disconnect_cb_(connected_ip_.c_str(), 
+                                    connected_port_, ctx_->errstr );
+            }
+            if(user_msg_cb_){
+                char tmp_msg [128];
+                snprintf(tmp_msg,sizeof(tmp_msg),"connect error :%s %ld, %s",
+                        connected_ip_.c_str(), connected_port_,ctx_->errstr);
+                user_msg_cb_(tmp_msg);
+            }
+            return Reconnect();
+        }
+        return false;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //hot path : copy only, no allocation, no formatting
+    void SetLastError(ENUM_REDIS_HELPER_ERR code, int endpoint_idx, int redis_err, 
+                      const char* detail) {
+        last_err_.sys_errno    = errno;
+        last_err_.code         = code;
+        last_err_.endpoint_idx = endpoint_idx;
+        last_err_.redis_err    = redis_err;
+        if(detail){
+            size_t len = strnlen(detail, sizeof(last_err_.detail)-1);
+            memcpy(last_err_.detail, detail, len);
+            last_err_.detail[len] = '\0';
+        }else{
+            last_err_.detail[0] = '\0';
+        }
+        is_err_msg_formatted_ = false;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    static long long NowMicroSecs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //1 : reply_ is set (error reply only if no other reply), endpoint_idx : replier
+    //0 : no usable endpoint
+    //-1: failed, last error is set
+    int HedgedRead(const char* cmd, size_t cmd_len, int* endpoint_idx) {
+        PrepareHedgeEndpoints();
+        hedge_tokens_ = std::min(hedge_tokens_ + hedge_max_ratio_, (double)HEDGE_MAX_TOKENS);
+
+        int       active_idx [2]  = {-1, -1}; //[0] first request, [1] hedge
+        long long start_us   [2]  = {0, 0};
+        active_idx[0] = SendHedgeRequest(-1, cmd, cmd_len);
+        if(active_idx[0] < 0){
+            return 0;
+        }
+        start_us[0] = NowMicroSecs();
+        long long hedge_at_us = start_us[0] + vec_hedge_eps_[active_idx[0]].delay_us;
+        long long deadline_us = start_us[0] + (long long)hedge_read_timeout_us_;
+        bool      is_hedge_time = false; //hedge time passed (sent or not)
+        bool      is_second_sent = false; //hedge or failover
+        int       first_idx     = active_idx[0];
+        int       failed_idx    = -1;
+        redisReply* err_reply   = NULL; //kept until a better reply arrives
+        int       err_idx       = -1;
+
+        while(true){
+            long long now_us = NowMicroSecs();
+            if(!is_second_sent){
+                //failover (first request failed) is not limited, any time
+                bool is_failover = (active_idx[0] < 0);
+                bool is_hedge    = false;
+                if(!is_failover && !is_hedge_time && now_us >= hedge_at_us){
+                    is_hedge_time = true;
+                    is_hedge      = (hedge_tokens_ >= 1.0);
+                }
+                if(is_failover || is_hedge){
+                    is_second_sent = true;
+                    active_idx[1] = SendHedgeRequest(first_idx, cmd, cmd_len);
+                    if(active_idx[1] >= 0){
+                        start_us[1] = NowMicroSecs();
+                        if(is_hedge){
+                            hedge_tokens_ -= 1.0;
+                            hedged_cnt_++;
+                            DEBUG_LOG ("hedge : " << active_idx[0] << " -> " << active_idx[1]);
+                        }
+                    }
+                }
+            }
+            if(active_idx[0] < 0 && active_idx[1] < 0){
+                break;
+            }
+            if(now_us >= deadline_us){
+                //stuck connections are closed, late replies are not read
+                for(size_t i=0; i < 2; i++){
+                    if(active_idx[i] >= 0){
+                        CloseHedgeEndpoint(active_idx[i]);
+                    }
+                }
+                if(err_reply){
+                    break;
+                }
+                SetLastError(REDIS_HELPER_ERR_HEDGE_TIMEOUT, 
+                             active_idx[0] >= 0 ? active_idx[0] : active_idx[1], 0, NULL);
+                return -1;
+            }
+            long long wait_us = deadline_us - now_us;
+            if(!is_hedge_time && !is_second_sent && hedge_at_us - now_us < wait_us){
+                wait_us = hedge_at_us - now_us;
+            }
+            struct pollfd fds [2];
+            int fd_idx [2];
+            int fd_cnt = 0;
+            for(size_t i=0; i < 2; i++){
+                if(active_idx[i] >= 0){
+                    fds[fd_cnt].fd      = vec_hedge_eps_[active_idx[i]].ctx->fd;
+                    fds[fd_cnt].events  = POLLIN;
+                    fds[fd_cnt].revents = 0;
+                    fd_idx[fd_cnt++]    = (int)i;
+                }
+            }
+            int timeout_ms = (int)((wait_us + 999) / 1000);
+            if(poll(fds, fd_cnt, timeout_ms) <= 0){
+                continue; //timeout or EINTR
+            }
+            for(int n=0; n < fd_cnt; n++){
+                if(fds[n].revents == 0){
+                    continue;
+                }
+                int i = fd_idx[n];
+                redisReply* reply = NULL;
+                int result = ReadHedgeReply(active_idx[i], &reply);
+                if(result < 0){
+                    failed_idx = active_idx[i];
+                    SetLastError(REDIS_HELPER_ERR_GET_REPLY, failed_idx, 
+                                 vec_hedge_eps_[failed_idx].ctx->err, 
+                                 vec_hedge_eps_[failed_idx].ctx->errstr);
+                    CloseHedgeEndpoint(failed_idx);
+                    active_idx[i] = -1;
+                    continue;
+                }
+                if(result == 0){
+                    continue; //partial
+                }
+                if(reply->type == REDIS_REPLY_ERROR){
+                    //(LOADING, MASTERDOWN..) : failed attempt, no latency sample.
+                    //the other request (or failover) may still succeed
+                    if(err_reply){
+                        freeReplyObject(err_reply);
+                    }
+                    err_reply     = reply;
+                    err_idx       = active_idx[i];
+                    active_idx[i] = -1;
+                    continue;
+                }
+                AddHedgeSample(active_idx[i], NowMicroSecs() - start_us[i]);
+                int other = active_idx[1-i];
+                if(other >= 0){
+                    //the first request lost : its elapsed time is a lower bound
+                    //of its latency. a lost hedge request was sent just now, 
+                    //so its elapsed time means nothing
+                    if(i == 1){
+                        AddHedgeSample(other, NowMicroSecs() - start_us[0]);
+                    }
+                    vec_hedge_eps_[other].pending_discard++;
+                }
+                if(err_reply){
+                    freeReplyObject(err_reply);
+                }
+                reply_ = reply;
+                *endpoint_idx = active_idx[i];
+                return 1;
+            }
+        }//while
+        if(err_reply){
+            reply_ = err_reply;
+            *endpoint_idx = err_idx;
+            return 1;
+        }
+        if(failed_idx < 0){
+            SetLastError(REDIS_HELPER_ERR_GET_REPLY, first_idx, 0, "hedged read failed");
+        }
+        return -1;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //read replies of lost requests (no connect here)
+    void PrepareHedgeEndpoints() {
+        if(vec_hedge_eps_.size() != vec_ip_ports_.size()){
+            vec_hedge_eps_.resize(vec_ip_ports_.size());
+        }
+        for(size_t i=0; i < vec_hedge_eps_.size(); i++){
+            HedgeEndpoint& ep = vec_hedge_eps_[i];
+            if(ep.ctx == NULL){
+                continue;
+            }
+            while(ep.pending_discard > 0){
+                void* reply = NULL;
+                if(redisGetReplyFromReader(ep.ctx, &reply) != REDIS_OK){
+                    CloseHedgeEndpoint((int)i);
+                    break;
+                }
+                if(reply){
+                    freeReplyObject(reply);
+                    ep.pending_discard--;
+                    continue;
+                }
+                struct pollfd fd = { ep.ctx->fd, POLLIN, 0 };
+                if(poll(&fd, 1, 0) <= 0){
+                    break; //not arrived yet
+                }
+                if(redisBufferRead(ep.ctx) != REDIS_OK){
+                    CloseHedgeEndpoint((int)i);
+                    break;
+                }
+            }
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //send to the usable endpoint with the lowest hedge delay. -1 : none
+    int SendHedgeRequest(int exclude_idx, const char* cmd, size_t cmd_len) {
+        while(true){
+            int best = -1;
+            for(size_t i=0; i < vec_hedge_eps_.size(); i++){
+                const HedgeEndpoint& ep = vec_hedge_eps_[i];
+                if((int)i == exclude_idx || ep.ctx == NULL || ep.pending_discard > 0){
+                    continue;
+                }
+                if(best < 0 || ep.delay_us < vec_hedge_eps_[best].delay_us){
+                    best = (int)i;
+                }
+            }
+            if(best < 0){
+                return -1;
+            }
+            redisContext* ctx = vec_hedge_eps_[best].ctx;
+            int done = 0;
+            bool is_ok = (redisAppendFormattedCommand(ctx, cmd, cmd_len) == REDIS_OK);
+            while(is_ok && !done){
+                is_ok = (redisBufferWrite(ctx, &done) == REDIS_OK);
+            }
+            if(is_ok){
+                return best;
+            }
+            CloseHedgeEndpoint(best);
+        }
+        return -1;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //1 : reply, 0 : not complete yet, -1 : error
+    int ReadHedgeReply(int idx, redisReply** reply) {
+        redisContext* ctx = vec_hedge_eps_[idx].ctx;
+        if(redisBufferRead(ctx) != REDIS_OK){
+            return -1;
+        }
+        if(redisGetReplyFromReader(ctx, (void**)reply) != REDIS_OK){
+            return -1;
+        }
+        return (*reply == NULL) ? 0 : 1;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    void AddHedgeSample(int idx, long long elapsed_us) {
+        HedgeEndpoint& ep = vec_hedge_eps_[idx];
+        ep.samples[ep.sample_pos] = elapsed_us;
+        ep.sample_pos = (ep.sample_pos + 1) % HEDGE_SAMPLE_CNT;
+        if(ep.sample_cnt < HEDGE_SAMPLE_CNT){
+            ep.sample_cnt++;
+        }
+        if(++ep.sample_updated < HEDGE_UPDATE_INTERVAL){
+            return;
+        }
+        ep.sample_updated = 0;
+        long long sorted [HEDGE_SAMPLE_CNT];
+        std::copy(ep.samples, ep.samples + ep.sample_cnt, sorted);
+        size_t nth = (size_t)(ep.sample_cnt * hedge_percentile_ / 100.0);
+        if(nth >= ep.sample_cnt){
+            nth = ep.sample_cnt -1;
+        }
+        std::nth_element(sorted, sorted + nth, sorted + ep.sample_cnt);
+        ep.delay_us = std::max(sorted[nth], (long long)hedge_min_delay_us_);
+        DEBUG_LOG ("hedge delay of " << idx << " : " << ep.delay_us << " us");
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    void CloseHedgeEndpoint(int idx) {
+        HedgeEndpoint& ep = vec_hedge_eps_[idx];
+        if(ep.ctx){
+            redisFree(ep.ctx);
+            ep.ctx = NULL;
+        }
+        ep.pending_discard = 0;
+    }
+    void CloseHedgeEndpoints() {
+        for(size_t i=0; i < vec_hedge_eps_.size(); i++){
+            if(vec_hedge_eps_[i].ctx){
+                redisFree(vec_hedge_eps_[i].ctx);
+            }
+        }
+        vec_hedge_eps_.clear();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    void FormatLastError() {
+        char tmp_msg [512];
+        const char* ip = "";
+        size_t port = 0;
+        if(last_err_.endpoint_idx >=0 && 
+           (size_t)last_err_.endpoint_idx < vec_ip_ports_.size()){
+            ip   = vec_ip_ports_[last_err_.endpoint_idx].ip.c_str();
+            port = vec_ip_ports_[last_err_.endpoint_idx].port;
+        }
+        int len = snprintf(tmp_msg, sizeof(tmp_msg), "%s:%ld -> %s", 
+                           ip, port, GetErrCodeStr(last_err_.code));
+        if(last_err_.detail[0] != '\0' && len >0 && (size_t)len < sizeof(tmp_msg)){
+            len += snprintf(tmp_msg+len, sizeof(tmp_msg)-len, ",%s", last_err_.detail);
+        }
+        if(last_err_.redis_err != 0 && len >0 && (size_t)len < sizeof(tmp_msg)){
+            len += snprintf(tmp_msg+len, sizeof(tmp_msg)-len, ",%d", last_err_.redis_err);
+        }
+        if(last_err_.code == REDIS_HELPER_ERR_GET_REPLY && last_err_.sys_errno != 0 && 
+           len >0 && (size_t)len < sizeof(tmp_msg)){
+            snprintf(tmp_msg+len, sizeof(tmp_msg)-len, ":%s", strerror(last_err_.sys_errno));
+        }
+        err_msg_ = tmp_msg;
+    }
+
   protected:
     CONNECT_CALLBACK    user_connect_cb_   ;
     DISCONNECT_CALLBACK user_disconnect_cb_;
@@ -441,12 +1216,24 @@ class RedisHelper
     size_t              connect_timeout_   ;
     size_t              max_reconn_retry_  ;
     size_t              pipe_appended_cnt_ ;
-    std::string         err_msg_           ;
+    RedisError          last_err_          ;
+    std::string         err_msg_           ; //formatted from last_err_ on demand
+    bool                is_err_msg_formatted_;
     std::string         connected_ip_      ; 
     size_t              connected_port_    ; 
+    int                 connected_idx_     ; //index of vec_ip_ports_
+    size_t              connect_cnt_       ; //changes when connection is replaced
     size_t              reconnect_interval_micro_secs_ ; 
     bool                is_connected_      ;
     VecConnIpPorts      vec_ip_ports_      ;
+    VecHedgeEndpoints   vec_hedge_eps_     ; //same order as vec_ip_ports_
+    bool                is_hedge_enabled_  ;
+    double              hedge_percentile_  ;
+    size_t              hedge_min_delay_us_;
+    double              hedge_max_ratio_   ;
+    double              hedge_tokens_      ;
+    size_t              hedge_read_timeout_us_ ;
+    size_t              hedged_cnt_        ;
 
   public:
     int                 user_specific_     ;
@@ -457,4 +1244,3 @@ typedef VecRedisHelperPtr::iterator ItRedisHelperPtr ;
 
 #endif // REDIS_HELPER_HPP
 
-
@@ -0,0 +1,313 @@
+/****************************************************************************
+ Copyright (c) 2020 ko jung hyun
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+#ifndef REDIS_HELPER_LOG_HPP
+#define REDIS_HELPER_LOG_HPP
+
+#include <unistd.h> //usleep
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <functional>
+
+///////////////////////////////////////////////////////////////////////////////
+//color printf
+#define COLOR_RED  "\x1B[31m"
+#define COLOR_GREEN "\x1B[32m"
+#define COLOR_BLUE "\x1B[34m"
+#define COLOR_RESET "\x1B[0m"
+
+#define  LOG_WHERE "("<<__FILE__<<"-"<<__func__<<"-"<<__LINE__<<") "
+#define  WHERE_DEF __FILE__,__func__,__LINE__
+
+///////////////////////////////////////////////////////////////////////////////
+//log levels. REDIS_HELPER_LOG_LEVEL selects the lowest level compiled in,
+//every macro below that level expands to nothing.
+#define REDIS_LOG_LEVEL_DEBUG 0
+#define REDIS_LOG_LEVEL_INFO  1
+#define REDIS_LOG_LEVEL_WARN  2
+#define REDIS_LOG_LEVEL_ERROR 3
+#define REDIS_LOG_LEVEL_OFF   4
+
+#ifndef REDIS_HELPER_LOG_LEVEL
+#ifdef DEBUG_PRINTF
+#define REDIS_HELPER_LOG_LEVEL REDIS_LOG_LEVEL_DEBUG
+#else
+#define REDIS_HELPER_LOG_LEVEL REDIS_LOG_LEVEL_OFF
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+const size_t LOG_RING_SLOT_CNT = 1024 ; //must be power of 2
+const size_t LOG_LINE_MAX_LEN  = 256  ; //longer lines are truncated
+const size_t LOG_WRITER_MIN_SLEEP_MICRO_SECS = 1000  ; //doubled while idle
+const size_t LOG_WRITER_MAX_SLEEP_MICRO_SECS = 100000;
+
+//level, formatted line (without new line)
+typedef std::function<void(int,const char*)> LOG_SINK_CALLBACK ;
+
+///////////////////////////////////////////////////////////////////////////////
+//lock-free bounded MPSC ring buffer + background writer thread.
+//Push never blocks and never allocates : when the ring is full the line is
+//dropped and counted (GetDroppedCnt). The sink is only invoked from the
+//writer thread (or Flush), never from the thread that logged.
+class RedisLogger
+{
+  public:
+    static RedisLogger& Instance() {
+        static RedisLogger logger;
+        return logger;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //the sink is called while the ring is being drained.
+    //do not call SetSink or Flush inside the sink.
+    void SetSink(LOG_SINK_CALLBACK sink) {
+        std::lock_guard<std::mutex> lock(drain_lock_);
+        sink_ = sink ;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    void Push(int level, const char* msg, size_t len) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        LogSlot* slot = NULL;
+        while(true){
+            slot = &slots_[pos & (LOG_RING_SLOT_CNT-1)];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if(diff == 0){
+                if(enqueue_pos_.compare_exchange_weak(pos, pos+1,
+                                                      std::memory_order_relaxed)){
+                    break;
+                }
+            }else if(diff < 0){
+                //full : never block the caller
+                dropped_cnt_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }else{
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        if(len >= LOG_LINE_MAX_LEN){
+            len = LOG_LINE_MAX_LEN -1;
+        }
+        slot->level = level;
+        memcpy(slot->msg, msg, len);
+        slot->msg[len] = '\0';
+        slot->seq.store(pos+1, std::memory_order_release);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //write all queued lines to the sink on the calling thread
+    size_t Flush() {
+        return Drain();
+    }
+    size_t GetDroppedCnt() {
+        return dropped_cnt_.load(std::memory_order_relaxed);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    static void DefaultSink(int level, const char* msg) {
+        switch(level){
+            case REDIS_LOG_LEVEL_ERROR:
+                std::cerr << COLOR_RED << msg << COLOR_RESET << "\n";
+                break;
+            case REDIS_LOG_LEVEL_WARN:
+                std::cout << COLOR_RED << msg << COLOR_RESET << "\n";
+                break;
+            case REDIS_LOG_LEVEL_INFO:
+                std::cout << COLOR_GREEN << msg << COLOR_RESET << "\n";
+                break;
+            default:
+                std::cout << msg << "\n";
+                break;
+        }
+    }
+
+  protected:
+    RedisLogger() {
+        for(size_t i=0; i < LOG_RING_SLOT_CNT; i++){
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+        enqueue_pos_.store(0, std::memory_order_relaxed);
+        dequeue_pos_ = 0;
+        dropped_cnt_.store(0, std::memory_order_relaxed);
+        is_stop_.store(false, std::memory_order_relaxed);
+        sink_   = DefaultSink ;
+        writer_ = std::thread(&RedisLogger::WriterThread, this);
+    }
+    ~RedisLogger() {
+        is_stop_.store(true, std::memory_order_release);
+        if(writer_.joinable()){
+            writer_.join();
+        }
+        Drain();
+    }
+    RedisLogger(const RedisLogger&) = delete;
+    RedisLogger& operator=(const RedisLogger&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////
+    //sleeps longer while the ring stays empty, so an idle logger costs
+    //a wake-up every LOG_WRITER_MAX_SLEEP_MICRO_SECS only
+    void WriterThread() {
+        size_t sleep_micro_secs = LOG_WRITER_MIN_SLEEP_MICRO_SECS;
+        while(!is_stop_.load(std::memory_order_acquire)){
+            if(Drain() > 0){
+                sleep_micro_secs = LOG_WRITER_MIN_SLEEP_MICRO_SECS;
+                continue;
+            }
+            usleep(sleep_micro_secs);
+            sleep_micro_secs *= 2;
+            if(sleep_micro_secs > LOG_WRITER_MAX_SLEEP_MICRO_SECS){
+                sleep_micro_secs = LOG_WRITER_MAX_SLEEP_MICRO_SECS;
+            }
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //single consumer : drain_lock_ serializes the writer thread and Flush
+    size_t Drain() {
+        std::lock_guard<std::mutex> lock(drain_lock_);
+        size_t cnt = 0;
+        while(true){
+            LogSlot& slot = slots_[dequeue_pos_ & (LOG_RING_SLOT_CNT-1)];
+            size_t seq = slot.seq.load(std::memory_order_acquire);
+            if((intptr_t)seq - (intptr_t)(dequeue_pos_+1) < 0){
+                break; //empty
+            }
+            if(sink_){
+                sink_(slot.level, slot.msg);
+            }
+            slot.seq.store(dequeue_pos_ + LOG_RING_SLOT_CNT, std::memory_order_release);
+            dequeue_pos_++;
+            cnt++;
+        }
+        return cnt;
+    }
+
+  protected:
+    struct LogSlot {
+        std::atomic<size_t> seq ;
+        int                 level ;
+        char                msg [LOG_LINE_MAX_LEN];
+    };
+    LogSlot                          slots_ [LOG_RING_SLOT_CNT];
+    alignas(64) std::atomic<size_t>  enqueue_pos_ ;
+    alignas(64) size_t               dequeue_pos_ ;
+    std::atomic<size_t>              dropped_cnt_ ;
+    std::atomic<bool>                is_stop_     ;
+    std::mutex                       drain_lock_  ;
+    LOG_SINK_CALLBACK                sink_        ;
+    std::thread                      writer_      ;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//formats one line into a stack buffer and pushes it to the ring on destruction
+class RedisLogLine
+{
+  public:
+    RedisLogLine(int level, const char* file, const char* func, int line) {
+        level_ = level;
+        len_   = 0;
+        Printf("(%s-%s-%d) ", file, func, line);
+    }
+    ~RedisLogLine() {
+        RedisLogger::Instance().Push(level_, buf_, len_);
+    }
+    RedisLogLine& operator<<(const char* val) {
+        return Printf("%s", val ? val : "(null)");
+    }
+    RedisLogLine& operator<<(const std::string& val) { return Printf("%s", val.c_str()); }
+    RedisLogLine& operator<<(char val)               { return Printf("%c", val); }
+    RedisLogLine& operator<<(bool val)               { return Printf("%s", val?"true":"false"); }
+    RedisLogLine& operator<<(int val)                { return Printf("%d", val); }
+    RedisLogLine& operator<<(unsigned int val)       { return Printf("%u", val); }
+    RedisLogLine& operator<<(long val)               { return Printf("%ld", val); }
+    RedisLogLine& operator<<(unsigned long val)      { return Printf("%lu", val); }
+    RedisLogLine& operator<<(long long val)          { return Printf("%lld", val); }
+    RedisLogLine& operator<<(unsigned long long val) { return Printf("%llu", val); }
+    RedisLogLine& operator<<(double val)             { return Printf("%f", val); }
+    RedisLogLine& operator<<(const void* val)        { return Printf("%p", val); }
+
+  protected:
+    __attribute__((format(printf, 2, 3)))
+    RedisLogLine& Printf(const char* fmt, ...) {
+        if(len_ >= sizeof(buf_) -1){
+            return *this; //truncated
+        }
+        va_list ap;
+        va_start(ap, fmt);
+        int written = vsnprintf(buf_+len_, sizeof(buf_)-len_, fmt, ap);
+        va_end(ap);
+        if(written > 0){
+            len_ += (size_t)written;
+            if(len_ >= sizeof(buf_)){
+                len_ = sizeof(buf_) -1;
+            }
+        }
+        return *this;
+    }
+    int     level_ ;
+    size_t  len_   ;
+    char    buf_ [LOG_LINE_MAX_LEN];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+#define REDIS_LOG_AT(level, x) \
+    do { RedisLogLine redis_log_line_(level, WHERE_DEF); redis_log_line_ << x; } while(0)
+
+#if REDIS_HELPER_LOG_LEVEL <= REDIS_LOG_LEVEL_DEBUG
+#define REDIS_LOG_DEBUG(x) REDIS_LOG_AT(REDIS_LOG_LEVEL_DEBUG, x)
+#else
+#define REDIS_LOG_DEBUG(x) do {} while(0)
+#endif
+#if REDIS_HELPER_LOG_LEVEL <= REDIS_LOG_LEVEL_INFO
+#define REDIS_LOG_INFO(x)  REDIS_LOG_AT(REDIS_LOG_LEVEL_INFO, x)
+#else
+#define REDIS_LOG_INFO(x)  do {} while(0)
+#endif
+#if REDIS_HELPER_LOG_LEVEL <= REDIS_LOG_LEVEL_WARN
+#define REDIS_LOG_WARN(x)  REDIS_LOG_AT(REDIS_LOG_LEVEL_WARN, x)
+#else
+#define REDIS_LOG_WARN(x)  do {} while(0)
+#endif
+#if REDIS_HELPER_LOG_LEVEL <= REDIS_LOG_LEVEL_ERROR
+#define REDIS_LOG_ERROR(x) REDIS_LOG_AT(REDIS_LOG_LEVEL_ERROR, x)
+#else
+#define REDIS_LOG_ERROR(x) do {} while(0)
+#endif
+
+//kept for existing code
+#define  DEBUG_LOG(x)       REDIS_LOG_DEBUG(x)
+#define  DEBUG_GREEN_LOG(x) REDIS_LOG_INFO(x)
+#define  DEBUG_RED_LOG(x)   REDIS_LOG_WARN(x)
+#define  DEBUG_ELOG(x)      REDIS_LOG_ERROR(x)
+#define  PRINT_ELOG(x)      REDIS_LOG_AT(REDIS_LOG_LEVEL_ERROR, x) //not filtered
+
+#endif // REDIS_HELPER_LOG_HPP
+
@@ -0,0 +1,389 @@
+/****************************************************************************
+ Copyright (c) 2020 ko jung hyun
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+#ifndef REDIS_SHARD_HELPER_HPP
+#define REDIS_SHARD_HELPER_HPP
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "redis_helper.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+//client side sharding across independent masters (no redis cluster).
+//every shard is a RedisHelper with its own master/replica group, so failover
+//of a shard is the usual RedisHelper::Reconnect().
+//keys are mapped with jump consistent hash : adding a shard at the end moves
+//only 1/n of the keys. {hash tag} is supported like redis cluster.
+//multi-key commands and pipelines are written to every shard first and then
+//the replies are read, so the shards work in parallel on one thread.
+//not thread-safe (same as RedisHelper).
+class RedisShardHelper
+{
+  public:
+    RedisShardHelper() {
+        last_shard_idx_ = 0;
+        err_shard_idx_  = 0;
+        is_own_err_msg_ = true;
+        has_err_shard_  = false;
+        err_msg_        = "no shard";
+    }
+    virtual ~RedisShardHelper() {
+        for(size_t i=0; i < vec_shards_.size(); i++){
+            delete vec_shards_[i];
+        }
+        vec_shards_.clear();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //returns shard index.
+    //shard order must be the same on every client (key mapping depends on it)
+    size_t AddShard() {
+        vec_shards_.push_back(new RedisHelper());
+        DEBUG_LOG("shard cnt=" << vec_shards_.size());
+        return vec_shards_.size() -1;
+    }
+    //master/replica of the shard
+    void SetIpsPorts (size_t shard_idx, const char* ip, size_t port){
+        vec_shards_[shard_idx]->SetIpsPorts(ip, port);
+    }
+    //for per shard settings (callbacks, timeouts ...)
+    RedisHelper* GetShardAt(size_t shard_idx) { return vec_shards_[shard_idx]; }
+    size_t       GetShardCnt() { return vec_shards_.size(); }
+
+    ////////////////////////////////////////////////////////////////////////////
+    bool ConnectServer() {
+        if(vec_shards_.empty()){
+            SetError("no shard");
+            return false;
+        }
+        bool result = true;
+        for(size_t i=0; i < vec_shards_.size(); i++){
+            if(!vec_shards_[i]->ConnectServer()){
+                SetErrShard(i);
+                DEBUG_ELOG ("shard " << i << " : " << vec_shards_[i]->GetLastErrMsg());
+                result = false;
+            }
+        }
+        return result;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    size_t GetShardIdx(const char* key, size_t len) {
+        return JumpHash(HashKey(key, len), vec_shards_.size());
+    }
+    size_t GetShardIdx(const std::string& key) {
+        return GetShardIdx(key.c_str(), key.size());
+    }
+    //NULL if no shard is added
+    RedisHelper* GetShard(const std::string& key) {
+        if(vec_shards_.empty()){
+            return NULL;
+        }
+        return vec_shards_[GetShardIdx(key)];
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //single key command. reply : GetReply()
+    bool DoCommand(const std::string& key, const char* format, ...) {
+        if(vec_shards_.empty()){
+            SetError("no shard");
+            return false;
+        }
+        last_shard_idx_ = GetShardIdx(key);
+        va_list ap;
+        va_start(ap, format);
+        bool result = vec_shards_[last_shard_idx_]->DoCommandV(format, ap);
+        va_end(ap);
+        if(!result){
+            SetErrShard(last_shard_idx_);
+        }
+        return result;
+    }
+    redisReply* GetReply() {
+        if(vec_shards_.empty()){
+            return NULL;
+        }
+        return vec_shards_[last_shard_idx_]->GetReply();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    bool AppendCmdPipeline(const std::string& key, const char* format, ... ) {
+        if(vec_shards_.empty()){
+            SetError("no shard");
+            return false;
+        }
+        size_t shard_idx = GetShardIdx(key);
+        va_list ap;
+        va_start(ap, format);
+        bool result = vec_shards_[shard_idx]->AppendCmdPipelineV(format, ap);
+        va_end(ap);
+        if(!result){
+            SetErrShard(shard_idx);
+        }
+        return result;
+    }
+    //send pipelines of all shards, then read replies of each shard
+    bool EndCmdPipeline(bool do_reconnect = true) {
+        FlushShards();
+        bool result = true;
+        for(size_t i=0; i < vec_shards_.size(); i++){
+            if(vec_shards_[i]->GetAppendedCmdCnt() == 0){
+                continue;
+            }
+            if(!vec_shards_[i]->EndCmdPipeline(do_reconnect)){
+                SetErrShard(i);
+                result = false;
+            }
+        }
+        return result;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //values are in the order of keys. nil --> "" and is_exists[i] = false
+    bool MGet(const std::vector<std::string>& keys, std::vector<std::string>& values,
+              std::vector<bool>* is_exists = NULL) {
+        values.assign(keys.size(), std::string());
+        if(is_exists){
+            is_exists->assign(keys.size(), false);
+        }
+        if(!FanOut("MGET", keys, 1)){
+            return false;
+        }
+        for(size_t shard=0; shard < vec_shards_.size(); shard++){
+            const std::vector<size_t>& key_indexes = vec_shard_key_indexes_[shard];
+            if(key_indexes.empty()){
+                continue;
+            }
+            redisReply* reply = vec_shards_[shard]->GetReply();
+            if(reply == NULL || reply->type != REDIS_REPLY_ARRAY ||
+               reply->elements != key_indexes.size()){
+                SetReplyError(shard, reply, "MGet : unexpected reply");
+                return false;
+            }
+            for(size_t i=0; i < key_indexes.size(); i++){
+                redisReply* elem = reply->element[i];
+                if(elem->type != REDIS_REPLY_STRING){
+                    continue;
+                }
+                values[key_indexes[i]].assign(elem->str, elem->len);
+                if(is_exists){
+                    (*is_exists)[key_indexes[i]] = true;
+                }
+            }
+        }
+        return true;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //key_values : key1, value1, key2, value2 ...
+    bool MSet(const std::vector<std::string>& key_values) {
+        if(key_values.size() % 2 != 0){
+            SetError("MSet : odd number of key_values");
+            return false;
+        }
+        return FanOut("MSET", key_values, 2) && CheckFanOutReplies(NULL);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    bool Del(const std::vector<std::string>& keys, long long* deleted_cnt = NULL) {
+        return FanOut("DEL", keys, 1) && CheckFanOutReplies(deleted_cnt);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //shard of the last error (error replies included). 
+    //NULL if the error is not from a shard
+    RedisHelper* GetErrShard() { 
+        if(!has_err_shard_){
+            return NULL;
+        }
+        return vec_shards_[err_shard_idx_]; 
+    }
+    const char*  GetLastErrMsg () {
+        if(is_own_err_msg_){
+            return err_msg_.c_str();
+        }
+        return vec_shards_[err_shard_idx_]->GetLastErrMsg();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //Lamping, Veach : A Fast, Minimal Memory, Consistent Hash Algorithm
+    static size_t JumpHash(uint64_t key, size_t bucket_cnt) {
+        int64_t b = -1, j = 0;
+        while (j < (int64_t)bucket_cnt) {
+            b = j;
+            key = key * 2862933555777941757ULL + 1;
+            j = (int64_t)((b + 1) * (double(1LL << 31) / double((key >> 33) + 1)));
+        }
+        return (size_t)b;
+    }
+    //FNV-1a 64. if key has a non-empty {hash tag}, only the tag is hashed
+    static uint64_t HashKey(const char* key, size_t len) {
+        const char* open = (const char*)memchr(key, '{', len);
+        if(open){
+            size_t rest = len - (open - key) -1;
+            const char* close = (const char*)memchr(open+1, '}', rest);
+            if(close && close > open+1){
+                key = open+1;
+                len = close - key;
+            }
+        }
+        uint64_t hash = 14695981039346656037ULL;
+        for(size_t i=0; i < len; i++){
+            hash ^= (unsigned char)key[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+  protected:
+
+    ////////////////////////////////////////////////////////////////////////////
+    //args : groups of 'step' strings, the first of each group is the key.
+    //one command per shard. all shards are written before any reply is read.
+    //on success, GetReply() of each shard is its reply.
+    bool FanOut(const char* cmd, const std::vector<std::string>& args, size_t step) {
+        if(vec_shards_.empty()){
+            SetError("no shard");
+            return false;
+        }
+        //replies of those would be read and dropped here
+        for(size_t shard=0; shard < vec_shards_.size(); shard++){
+            if(vec_shards_[shard]->GetAppendedCmdCnt() > 0){
+                SetError("pipeline commands pending, call EndCmdPipeline first");
+                return false;
+            }
+        }
+        vec_shard_args_.resize(vec_shards_.size());
+        vec_shard_key_indexes_.resize(vec_shards_.size());
+        for(size_t shard=0; shard < vec_shards_.size(); shard++){
+            vec_shard_args_[shard].clear();
+            vec_shard_key_indexes_[shard].clear();
+        }
+        for(size_t i=0; i + step <= args.size(); i += step){
+            size_t shard = GetShardIdx(args[i]);
+            if(vec_shard_args_[shard].empty()){
+                vec_shard_args_[shard].push_back(cmd);
+            }
+            for(size_t j=0; j < step; j++){
+                vec_shard_args_[shard].push_back(args[i+j]);
+            }
+            vec_shard_key_indexes_[shard].push_back(i/step);
+        }
+        bool result = true;
+        for(size_t shard=0; shard < vec_shards_.size(); shard++){
+            if(vec_shard_args_[shard].empty()){
+                continue;
+            }
+            if(!vec_shards_[shard]->AppendCmdPipelineArgv(vec_shard_args_[shard])){
+                SetErrShard(shard);
+                result = false;
+            }
+        }
+        FlushShards();
+        for(size_t shard=0; shard < vec_shards_.size(); shard++){
+            if(vec_shards_[shard]->GetAppendedCmdCnt() == 0){
+                continue;
+            }
+            if(!vec_shards_[shard]->EndCmdPipelineLastReply()){
+                SetErrShard(shard);
+                result = false;
+            }
+        }
+        return result;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //after FanOut : fails on error reply, sums integer replies
+    bool CheckFanOutReplies(long long* integer_sum) {
+        if(integer_sum){
+            *integer_sum = 0;
+        }
+        for(size_t shard=0; shard < vec_shards_.size(); shard++){
+            if(vec_shard_args_[shard].empty()){
+                continue;
+            }
+            redisReply* reply = vec_shards_[shard]->GetReply();
+            if(reply == NULL || reply->type == REDIS_REPLY_ERROR){
+                SetReplyError(shard, reply, "no reply");
+                return false;
+            }
+            if(integer_sum && reply->type == REDIS_REPLY_INTEGER){
+                *integer_sum += reply->integer;
+            }
+        }
+        return true;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //error of the shard helper itself
+    void SetError(const char* msg) {
+        is_own_err_msg_ = true;
+        has_err_shard_  = false;
+        err_msg_        = msg;
+        DEBUG_ELOG (msg);
+    }
+    //error recorded in the shard (its GetLastErrMsg)
+    void SetErrShard(size_t shard_idx) {
+        is_own_err_msg_ = false;
+        has_err_shard_  = true;
+        err_shard_idx_  = shard_idx;
+    }
+    //unexpected or error reply : not recorded in the shard
+    void SetReplyError(size_t shard_idx, redisReply* reply, const char* msg) {
+        SetError(msg);
+        if(reply && reply->type == REDIS_REPLY_ERROR && reply->str){
+            err_msg_ = reply->str;
+        }
+        char tmp [32];
+        snprintf(tmp, sizeof(tmp), "shard %ld -> ", shard_idx);
+        err_msg_.insert(0, tmp);
+        has_err_shard_ = true;
+        err_shard_idx_ = shard_idx;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    void FlushShards() {
+        for(size_t shard=0; shard < vec_shards_.size(); shard++){
+            if(vec_shards_[shard]->GetAppendedCmdCnt() > 0){
+                vec_shards_[shard]->FlushCmdPipeline();
+            }
+        }
+    }
+
+  protected:
+    VecRedisHelperPtr   vec_shards_        ;
+    size_t              last_shard_idx_    ;
+    size_t              err_shard_idx_     ;
+    bool                is_own_err_msg_    ; //true : err_msg_, false : shard's error
+    bool                has_err_shard_     ; //err_shard_idx_ is valid
+    std::string         err_msg_           ;
+    std::vector<std::vector<std::string> > vec_shard_args_ ; //reused buffers
+    std::vector<std::vector<size_t> >      vec_shard_key_indexes_ ;
+
+  private:
+    RedisShardHelper(const RedisShardHelper&) = delete;
+    RedisShardHelper& operator=(const RedisShardHelper&) = delete;
+};
+
+#endif // REDIS_SHARD_HELPER_HPP
+